@@ -0,0 +1,217 @@
+//************************************************
+//*                                              *
+//*                BaseLineStats.h               *
+//*                                              *
+//************************************************
+
+// Streaming base line statistics of a single channel. Signals are
+// passed one by one and only running sums are kept. The only part
+// growing with the size of the data is the drift trend: one point
+// (32 B) per trendBlock events, i.e. 3.2 kB per million events with
+// the default block of 10000. For each channel following
+// quantities are collected:
+//   - mean and RMS of the event base lines (Welford algorithm),
+//   - mean noise, i.e. RMS of samples within the base line window,
+//   - drift trend: mean and RMS of the base line in blocks of events.
+// Each signal is checked for:
+//   - base line jump - base line differs from the running average
+//     of the previous signals by more than jumpThreshold,
+//   - saturation - any sample reaching the lower (satLow) or upper
+//     (satHigh) limit of the ADC range; defaults correspond to the
+//     12-bit digitizer (1 Vpp, 4.096 ADC/mV),
+//   - pile-up in the pre-trigger region - any sample of the base line
+//     window deviates from the base line by more than pileUpThreshold.
+// All values are in ADC channels.
+//
+// Header is ROOT-free and can be used in standalone programs.
+
+#ifndef __BaseLineStats_H_
+#define __BaseLineStats_H_ 1
+
+#include <cmath>
+#include <vector>
+
+//-----------------------------------------------------------------
+
+struct BaseLineConfig{
+  int   nSamples;         // number of samples in 1 signal
+  int   nBL;              // number of points for base line calculation
+  float jumpThreshold;    // base line jump [ADC]
+  float pileUpThreshold;  // deviation in the base line window [ADC]
+  float satLow;           // lower limit of the ADC range [ADC]
+  float satHigh;          // upper limit of the ADC range [ADC]
+  long long trendBlock;   // number of events in one point of the drift trend
+  double smoothing;       // weight of the new event in the running base line
+
+  BaseLineConfig() : nSamples(1024), nBL(50), jumpThreshold(10),
+                     pileUpThreshold(20), satLow(0), satHigh(4095),
+                     trendBlock(10000), smoothing(0.01) {}
+};
+
+//-----------------------------------------------------------------
+
+// Running mean and variance (Welford algorithm)
+
+struct RunningStats{
+  long long n;
+  double mean;
+  double m2;
+
+  RunningStats() : n(0), mean(0), m2(0) {}
+
+  void Add(double x){
+    n++;
+    double delta = x-mean;
+    mean+=delta/n;
+    m2+=delta*(x-mean);
+  }
+
+  double GetRMS(void) const { return n>1 ? std::sqrt(m2/(n-1)) : 0; }
+};
+
+//-----------------------------------------------------------------
+
+class BaseLineStats{
+
+public:
+  // Flags returned by Process()
+  enum Flag { kOK = 0, kJump = 1, kSaturation = 2, kPileUp = 4 };
+
+  // One point of the drift trend
+  struct TrendPoint{
+    long long first;     // first event in the block
+    long long n;         // number of events in the block
+    double mean;         // mean base line
+    double rms;          // RMS of the base line
+  };
+
+  explicit BaseLineStats(const BaseLineConfig &cfg = BaseLineConfig())
+    : fCfg(cfg), fBlockFirst(0), fRunning(0), fNFlagged(0), fNJumps(0),
+      fNSaturated(0), fNPileUp(0), fLastBL(0), fLastNoise(0) {}
+
+  // Adds signal of the event ev, returns combination of flags.
+  int Process(const float *sig, long long ev);
+
+  // Closes the last, incomplete block of the drift trend.
+  void Finish(void);
+
+  const RunningStats& GetBaseLine(void) const { return fBL; }
+  const RunningStats& GetNoise(void) const { return fNoise; }
+  const std::vector <TrendPoint>& GetTrend(void) const { return fTrend; }
+
+  long long GetNEvents(void) const { return fBL.n; }
+  long long GetNFlagged(void) const { return fNFlagged; }
+  long long GetNJumps(void) const { return fNJumps; }
+  long long GetNSaturated(void) const { return fNSaturated; }
+  long long GetNPileUp(void) const { return fNPileUp; }
+
+  // Base line and noise of the last processed signal
+  float GetLastBaseLine(void) const { return fLastBL; }
+  float GetLastNoise(void) const { return fLastNoise; }
+
+private:
+  BaseLineConfig fCfg;
+  RunningStats fBL;          // event base lines
+  RunningStats fNoise;       // RMS within the base line window
+  RunningStats fBlock;       // current block of the trend
+  long long fBlockFirst;
+  double fRunning;           // smoothed base line, reference for jumps
+  std::vector <TrendPoint> fTrend;
+  long long fNFlagged;
+  long long fNJumps;
+  long long fNSaturated;
+  long long fNPileUp;
+  float fLastBL;
+  float fLastNoise;
+};
+
+//-----------------------------------------------------------------
+
+inline int BaseLineStats::Process(const float *sig, long long ev){
+
+  int flags = kOK;
+  const int nBL = fCfg.nBL;
+
+  //----- base line and noise
+  float sum = 0;
+  for(int i=0; i<nBL; i++)
+    sum+=sig[i]-sig[0];
+  const float bl = sig[0]+sum/nBL;
+
+  float var = 0;
+  float maxdev = 0;
+  for(int i=0; i<nBL; i++){
+    float dev = sig[i]-bl;
+    var+=dev*dev;
+    if(std::fabs(dev)>maxdev) maxdev = std::fabs(dev);
+  }
+  const float noise = std::sqrt(var/nBL);
+
+  //----- saturation check, whole signal
+  float min = sig[0];
+  float max = sig[0];
+  for(int i=1; i<fCfg.nSamples; i++){
+    min = sig[i]<min ? sig[i] : min;
+    max = sig[i]>max ? sig[i] : max;
+  }
+
+  if(min<=fCfg.satLow || max>=fCfg.satHigh){
+    flags|=kSaturation;
+    fNSaturated++;
+  }
+
+  if(maxdev>fCfg.pileUpThreshold){
+    flags|=kPileUp;
+    fNPileUp++;
+  }
+
+  if(fBL.n==0)
+    fRunning = bl;
+  else if(std::fabs(bl-fRunning)>fCfg.jumpThreshold){
+    flags|=kJump;
+    fNJumps++;
+  }
+
+  // signals with pile-up don't affect the reference base line
+  if(!(flags & kPileUp))
+    fRunning+=fCfg.smoothing*(bl-fRunning);
+
+  if(flags!=kOK)
+    fNFlagged++;
+
+  //----- statistics and drift trend
+  fBL.Add(bl);
+  fNoise.Add(noise);
+
+  if(fBlock.n==0)
+    fBlockFirst = ev;
+  fBlock.Add(bl);
+  if(fBlock.n==fCfg.trendBlock)
+    Finish();
+
+  fLastBL = bl;
+  fLastNoise = noise;
+
+  return flags;
+}
+
+//-----------------------------------------------------------------
+
+inline void BaseLineStats::Finish(void){
+
+  if(fBlock.n==0)
+    return;
+
+  TrendPoint p;
+  p.first = fBlockFirst;
+  p.n = fBlock.n;
+  p.mean = fBlock.mean;
+  p.rms = fBlock.GetRMS();
+  fTrend.push_back(p);
+
+  fBlock = RunningStats();
+}
+
+//-----------------------------------------------------------------
+
+#endif
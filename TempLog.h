@@ -0,0 +1,484 @@
+//************************************************
+//*                                              *
+//*                  TempLog.h                   *
+//*                                              *
+//************************************************
+
+// Loader of temperature logs. Each line of the log contains sensor
+// ID, unix time stamp, temperature and unit, e.g.:
+//   28-0000446D 1554112345 23.56 C
+// Log is parsed in a single streaming pass, sensors are discovered
+// automatically (hashed lookup by ID). Parsed time series are saved
+// in a binary cache next to the log (<log>.tcache), which is used
+// as long as the log file doesn't change (size and modification
+// time are compared), so reloading is instant. Provides:
+//   - time-range queries (binary search, series are sorted by time),
+//   - temperature at a given time stamp (linear interpolation), e.g.
+//     to correlate temperature of an event with the gain,
+//   - downsampling for display: min/max per bucket or LTTB
+//     (largest triangle three buckets).
+//
+// Header is ROOT-free.
+
+#ifndef __TempLog_H_
+#define __TempLog_H_ 1
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+
+//-----------------------------------------------------------------
+
+class TempLog{
+
+public:
+  struct Series{
+    std::string id;                // sensor ID
+    std::vector <int64_t> time;    // unix time stamps, sorted
+    std::vector <float> temp;      // temperatures
+  };
+
+  TempLog() {}
+
+  // Loads the log. If useCache is set, cache is read when valid
+  // and written after parsing otherwise.
+  bool Load(const std::string &fname, bool useCache=true);
+
+  int GetNSensors(void) const { return fSeries.size(); }
+  const Series& GetSeries(int s) const { return fSeries[s]; }
+
+  // Index of the sensor which ID contains id (e.g. short ID "446D"),
+  // -1 if not found.
+  int FindSensor(const std::string &id) const;
+
+  // First and last time stamp among all sensors.
+  int64_t GetStart(void) const { return fStart; }
+  int64_t GetStop(void) const { return fStop; }
+
+  // Indices [first, last) of the points of sensor s with time in [t0, t1].
+  void GetRange(int s, int64_t t0, int64_t t1, size_t &first, size_t &last) const;
+
+  // Temperature of sensor s at time t (linear interpolation between
+  // neighbouring points), NaN if t is outside of the series.
+  double GetTemperature(int s, double t) const;
+
+  // Downsampling of points of sensor s within [t0, t1] to at most
+  // 2*nbuckets points: minimum and maximum of each bucket, in time order.
+  void DownsampleMinMax(int s, int64_t t0, int64_t t1, int nbuckets,
+                        std::vector <double> &x, std::vector <double> &y) const;
+
+  // Downsampling of points of sensor s within [t0, t1] to at most
+  // npoints points with the largest triangle three buckets algorithm.
+  void DownsampleLTTB(int s, int64_t t0, int64_t t1, int npoints,
+                      std::vector <double> &x, std::vector <double> &y) const;
+
+private:
+  std::vector <Series> fSeries;
+  int64_t fStart = 0;
+  int64_t fStop = 0;
+
+  bool Parse(const std::string &fname);
+  bool ReadCache(const std::string &cname, int64_t size, int64_t mtime);
+  bool WriteCache(const std::string &cname, int64_t size, int64_t mtime) const;
+  void Finalize(void);
+};
+
+//-----------------------------------------------------------------
+
+inline bool TempLog::Load(const std::string &fname, bool useCache){
+
+  struct stat st;
+  if(stat(fname.c_str(),&st)!=0){
+    std::cout << "Input file couldn't be open!" << std::endl;
+    std::cout << fname << std::endl;
+    return false;
+  }
+
+  const int64_t size = st.st_size;
+  const int64_t mtime = (int64_t)st.st_mtim.tv_sec*1000000000+st.st_mtim.tv_nsec;
+  const std::string cname = fname+".tcache";
+
+  if(useCache && ReadCache(cname,size,mtime))
+    return true;
+
+  if(!Parse(fname))
+    return false;
+
+  if(useCache && !WriteCache(cname,size,mtime))
+    std::cout << "Couldn't write cache " << cname << std::endl;
+
+  return true;
+}
+
+//-----------------------------------------------------------------
+
+inline bool TempLog::Parse(const std::string &fname){
+
+  FILE *input = fopen(fname.c_str(),"rb");
+  if(input==nullptr){
+    std::cout << "Input file couldn't be open!" << std::endl;
+    std::cout << fname << std::endl;
+    return false;
+  }
+
+  fSeries.clear();
+  std::unordered_map <std::string,int> sensors;
+  std::string id;
+
+  // file is read in blocks, incomplete last line of a block is
+  // moved to the beginning of the buffer
+  const size_t block = 1<<20;
+  std::vector <char> buffer(block+1);
+  size_t carry = 0;
+  bool eof = false;
+
+  while(!eof){
+    if(carry==block)           // line longer than the block - skipped
+      carry = 0;
+    size_t nread = fread(buffer.data()+carry,1,block-carry,input);
+    size_t n = carry+nread;
+    eof = nread==0 || feof(input);
+    if(eof && n>0 && buffer[n-1]!='\n')
+      buffer[n++] = '\n';
+
+    char *p = buffer.data();
+    char *end = buffer.data()+n;
+
+    while(true){
+      char *eol = (char*)memchr(p,'\n',end-p);
+      if(eol==nullptr)
+        break;
+      *eol = '\0';
+
+      //----- ID
+      while(*p==' ' || *p=='\t') p++;
+      char *id_end = p;
+      while(*id_end && *id_end!=' ' && *id_end!='\t' && *id_end!='\r') id_end++;
+
+      if(id_end>p){
+        id.assign(p,id_end);
+        char *q;
+        long long t = strtoll(id_end,&q,10);
+        if(q!=id_end){
+          char *r;
+          double temp = strtod(q,&r);
+          if(r!=q){
+            auto it = sensors.find(id);
+            int s;
+            if(it==sensors.end()){
+              s = fSeries.size();
+              sensors.emplace(id,s);
+              fSeries.push_back(Series());
+              fSeries.back().id = id;
+            }
+            else
+              s = it->second;
+            fSeries[s].time.push_back(t);
+            fSeries[s].temp.push_back(temp);
+          }
+        }
+      }
+
+      p = eol+1;
+    }
+
+    carry = end-p;
+    memmove(buffer.data(),p,carry);
+  }
+
+  fclose(input);
+  Finalize();
+
+  return true;
+}
+
+//-----------------------------------------------------------------
+
+inline void TempLog::Finalize(void){
+
+  fStart = std::numeric_limits<int64_t>::max();
+  fStop = std::numeric_limits<int64_t>::min();
+
+  for(size_t s=0; s<fSeries.size(); s++){
+    Series &ser = fSeries[s];
+
+    // logs are normally written in time order, sort only if needed
+    if(!std::is_sorted(ser.time.begin(),ser.time.end())){
+      std::vector <size_t> order(ser.time.size());
+      std::iota(order.begin(),order.end(),0);
+      std::stable_sort(order.begin(),order.end(),
+                       [&](size_t a, size_t b){ return ser.time[a]<ser.time[b]; });
+      Series sorted;
+      sorted.id = ser.id;
+      for(size_t i=0; i<order.size(); i++){
+        sorted.time.push_back(ser.time[order[i]]);
+        sorted.temp.push_back(ser.temp[order[i]]);
+      }
+      ser = sorted;
+    }
+
+    if(!ser.time.empty()){
+      fStart = std::min(fStart,ser.time.front());
+      fStop = std::max(fStop,ser.time.back());
+    }
+  }
+
+  if(fStart>fStop)
+    fStart = fStop = 0;
+}
+
+//-----------------------------------------------------------------
+
+// Cache layout: "DD6T", version, size and modification time of the
+// log, number of sensors, then for each sensor: ID length, ID, number
+// of points, time stamps (int64), temperatures (float).
+
+inline bool TempLog::ReadCache(const std::string &cname, int64_t size, int64_t mtime){
+
+  FILE *input = fopen(cname.c_str(),"rb");
+  if(input==nullptr)
+    return false;
+
+  char magic[4];
+  uint32_t version = 0, nsensors = 0;
+  int64_t csize = 0, cmtime = 0;
+  bool ok = fread(magic,1,4,input)==4 && memcmp(magic,"DD6T",4)==0 &&
+            fread(&version,sizeof(version),1,input)==1 && version==1 &&
+            fread(&csize,sizeof(csize),1,input)==1 && csize==size &&
+            fread(&cmtime,sizeof(cmtime),1,input)==1 && cmtime==mtime &&
+            fread(&nsensors,sizeof(nsensors),1,input)==1;
+
+  std::vector <Series> series(ok ? nsensors : 0);
+
+  for(uint32_t s=0; ok && s<nsensors; s++){
+    uint32_t idlen = 0;
+    uint64_t npoints = 0;
+    ok = fread(&idlen,sizeof(idlen),1,input)==1 && idlen<1024;
+    if(!ok) break;
+    series[s].id.resize(idlen);
+    ok = fread(&series[s].id[0],1,idlen,input)==idlen &&
+         fread(&npoints,sizeof(npoints),1,input)==1;
+    if(!ok) break;
+    series[s].time.resize(npoints);
+    series[s].temp.resize(npoints);
+    ok = fread(series[s].time.data(),sizeof(int64_t),npoints,input)==npoints &&
+         fread(series[s].temp.data(),sizeof(float),npoints,input)==npoints;
+  }
+
+  fclose(input);
+
+  if(!ok)
+    return false;
+
+  fSeries.swap(series);
+  Finalize();
+
+  return true;
+}
+
+//-----------------------------------------------------------------
+
+inline bool TempLog::WriteCache(const std::string &cname, int64_t size, int64_t mtime) const{
+
+  FILE *output = fopen(cname.c_str(),"wb");
+  if(output==nullptr)
+    return false;
+
+  uint32_t version = 1;
+  uint32_t nsensors = fSeries.size();
+  fwrite("DD6T",1,4,output);
+  fwrite(&version,sizeof(version),1,output);
+  fwrite(&size,sizeof(size),1,output);
+  fwrite(&mtime,sizeof(mtime),1,output);
+  fwrite(&nsensors,sizeof(nsensors),1,output);
+
+  for(uint32_t s=0; s<nsensors; s++){
+    uint32_t idlen = fSeries[s].id.size();
+    uint64_t npoints = fSeries[s].time.size();
+    fwrite(&idlen,sizeof(idlen),1,output);
+    fwrite(fSeries[s].id.data(),1,idlen,output);
+    fwrite(&npoints,sizeof(npoints),1,output);
+    fwrite(fSeries[s].time.data(),sizeof(int64_t),npoints,output);
+    fwrite(fSeries[s].temp.data(),sizeof(float),npoints,output);
+  }
+
+  bool ok = !ferror(output);
+  ok = fclose(output)==0 && ok;
+  if(!ok)
+    remove(cname.c_str());
+
+  return ok;
+}
+
+//-----------------------------------------------------------------
+
+inline int TempLog::FindSensor(const std::string &id) const{
+
+  for(size_t s=0; s<fSeries.size(); s++)
+    if(fSeries[s].id==id)
+      return s;
+
+  for(size_t s=0; s<fSeries.size(); s++)
+    if(fSeries[s].id.find(id)!=std::string::npos)
+      return s;
+
+  return -1;
+}
+
+//-----------------------------------------------------------------
+
+inline void TempLog::GetRange(int s, int64_t t0, int64_t t1,
+                              size_t &first, size_t &last) const{
+
+  const std::vector <int64_t> &time = fSeries[s].time;
+  first = std::lower_bound(time.begin(),time.end(),t0)-time.begin();
+  last = std::upper_bound(time.begin(),time.end(),t1)-time.begin();
+  if(last<first)
+    last = first;
+}
+
+//-----------------------------------------------------------------
+
+inline double TempLog::GetTemperature(int s, double t) const{
+
+  const Series &ser = fSeries[s];
+
+  if(ser.time.empty() || t<ser.time.front() || t>ser.time.back())
+    return std::numeric_limits<double>::quiet_NaN();
+
+  size_t i = std::lower_bound(ser.time.begin(),ser.time.end(),t)-ser.time.begin();
+
+  if(ser.time[i]==t || i==0)
+    return ser.temp[i];
+
+  double t0 = ser.time[i-1];
+  double t1 = ser.time[i];
+  return ser.temp[i-1]+(ser.temp[i]-ser.temp[i-1])*(t-t0)/(t1-t0);
+}
+
+//-----------------------------------------------------------------
+
+inline void TempLog::DownsampleMinMax(int s, int64_t t0, int64_t t1, int nbuckets,
+                                      std::vector <double> &x, std::vector <double> &y) const{
+
+  x.clear();
+  y.clear();
+
+  const Series &ser = fSeries[s];
+  size_t first, last;
+  GetRange(s,t0,t1,first,last);
+
+  const size_t n = last-first;
+  if(n==0 || nbuckets<1)
+    return;
+
+  if(n<=2*(size_t)nbuckets){
+    for(size_t i=first; i<last; i++){
+      x.push_back(ser.time[i]);
+      y.push_back(ser.temp[i]);
+    }
+    return;
+  }
+
+  for(int b=0; b<nbuckets; b++){
+    size_t i0 = first+n*b/nbuckets;
+    size_t i1 = first+n*(b+1)/nbuckets;
+    if(i0>=i1)
+      continue;
+    size_t imin = i0, imax = i0;
+    for(size_t i=i0+1; i<i1; i++){
+      if(ser.temp[i]<ser.temp[imin]) imin = i;
+      if(ser.temp[i]>ser.temp[imax]) imax = i;
+    }
+    size_t ia = std::min(imin,imax);
+    size_t ib = std::max(imin,imax);
+    x.push_back(ser.time[ia]);
+    y.push_back(ser.temp[ia]);
+    if(ib!=ia){
+      x.push_back(ser.time[ib]);
+      y.push_back(ser.temp[ib]);
+    }
+  }
+}
+
+//-----------------------------------------------------------------
+
+inline void TempLog::DownsampleLTTB(int s, int64_t t0, int64_t t1, int npoints,
+                                    std::vector <double> &x, std::vector <double> &y) const{
+
+  x.clear();
+  y.clear();
+
+  const Series &ser = fSeries[s];
+  size_t first, last;
+  GetRange(s,t0,t1,first,last);
+
+  const size_t n = last-first;
+  if(n==0 || npoints<1)
+    return;
+
+  if(n<=(size_t)npoints || npoints<3){
+    for(size_t i=first; i<last; i++){
+      x.push_back(ser.time[i]);
+      y.push_back(ser.temp[i]);
+    }
+    return;
+  }
+
+  // first and last points are always kept, the rest is divided
+  // into npoints-2 buckets
+  const double every = (double)(n-2)/(npoints-2);
+  size_t a = first;
+  x.push_back(ser.time[a]);
+  y.push_back(ser.temp[a]);
+
+  for(int b=0; b<npoints-2; b++){
+    // average of the next bucket
+    size_t next0 = first+1+(size_t)((b+1)*every);
+    size_t next1 = std::min(first+1+(size_t)((b+2)*every),last);
+    if(next0>=last) next0 = last-1;
+    if(next1<=next0) next1 = next0+1;
+    double avgx = 0, avgy = 0;
+    for(size_t i=next0; i<next1; i++){
+      avgx+=ser.time[i];
+      avgy+=ser.temp[i];
+    }
+    avgx/=(next1-next0);
+    avgy/=(next1-next0);
+
+    // point of the current bucket forming the largest triangle
+    size_t cur0 = first+1+(size_t)(b*every);
+    size_t cur1 = first+1+(size_t)((b+1)*every);
+    double ax = ser.time[a], ay = ser.temp[a];
+    double maxarea = -1;
+    size_t chosen = cur0;
+    for(size_t i=cur0; i<cur1; i++){
+      double area = std::fabs((ax-avgx)*(ser.temp[i]-ay)-(ax-ser.time[i])*(avgy-ay));
+      if(area>maxarea){
+        maxarea = area;
+        chosen = i;
+      }
+    }
+
+    x.push_back(ser.time[chosen]);
+    y.push_back(ser.temp[chosen]);
+    a = chosen;
+  }
+
+  x.push_back(ser.time[last-1]);
+  y.push_back(ser.temp[last-1]);
+}
+
+//-----------------------------------------------------------------
+
+#endif
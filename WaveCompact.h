@@ -0,0 +1,358 @@
+//************************************************
+//*                                              *
+//*                WaveCompact.h                 *
+//*                                              *
+//************************************************
+
+// Compact container for signals recorded by the Desktop Digitizer
+// (wave_N.ddc). Samples stored in wave_N.dat are integer ADC codes
+// written as float32, so they are stored here as int16, which is
+// lossless as long as every sample is an integer within the int16
+// range (converter checks it). Events are grouped in chunks of fixed
+// size. Each chunk may be delta-encoded (difference to the previous
+// sample within the event) and block-compressed with LZ4 or zstd.
+// Offsets of all chunks are stored in the index at the end of the
+// file, so access to any event requires decoding of one chunk only.
+//
+// File layout:
+//   WaveCompactHeader
+//   chunk 0, chunk 1, ... (compressed int16 samples)
+//   index - nChunks x WaveCompactChunk
+//
+// Compression libraries are optional. To enable them define
+// DD6_WITH_LZ4 and/or DD6_WITH_ZSTD and link -llz4 / -lzstd, e.g. in
+// ROOT session before loading macros with ACLiC:
+//   gSystem->AddIncludePath("-DDD6_WITH_ZSTD");
+//   gSystem->AddLinkedLibs("-lzstd");
+// Files without compression (only int16 and optionally delta) can
+// always be read.
+
+#ifndef __WaveCompact_H_
+#define __WaveCompact_H_ 1
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef DD6_WITH_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef DD6_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+//-----------------------------------------------------------------
+
+// Magic number "DD6C". As float32 this bit pattern is not an integer,
+// so it can't be confused with the first sample of a wave_N.dat file.
+#define WAVECOMPACT_MAGIC "DD6C"
+
+struct WaveCompactHeader{
+  char     magic[4];       // WAVECOMPACT_MAGIC
+  uint32_t version;        // format version, currently 1
+  uint32_t nSamples;       // number of samples in 1 signal
+  uint32_t chunkEvents;    // number of events in one chunk
+  uint64_t nEvents;        // number of events in the file
+  uint64_t nChunks;        // number of chunks
+  uint32_t codec;          // WaveCompact::Codec
+  uint32_t flags;          // WaveCompact::Flags
+  uint64_t indexOffset;    // position of the index in the file
+};
+
+struct WaveCompactChunk{
+  uint64_t offset;         // position of the chunk in the file
+  uint32_t size;           // compressed size [B]
+  uint32_t reserved;
+};
+
+//-----------------------------------------------------------------
+
+namespace WaveCompact{
+
+  enum Codec { kNone = 0, kLZ4 = 1, kZSTD = 2 };
+  enum Flags { kDelta = 1 };
+
+  // Largest number of events in one chunk accepted by the converter.
+  // Compressed size of a chunk is stored as uint32, so raw chunk
+  // (chunkEvents*nSamples int16 samples) has to stay well below 4 GB;
+  // 65536 events of 1024 samples give 128 MB.
+  const uint32_t kMaxChunkEvents = 65536;
+
+  inline const char* CodecName(uint32_t codec){
+    if(codec==kNone) return "none";
+    if(codec==kLZ4) return "lz4";
+    if(codec==kZSTD) return "zstd";
+    return "unknown";
+  }
+
+  inline bool CodecAvailable(uint32_t codec){
+    if(codec==kNone) return true;
+#ifdef DD6_WITH_LZ4
+    if(codec==kLZ4) return true;
+#endif
+#ifdef DD6_WITH_ZSTD
+    if(codec==kZSTD) return true;
+#endif
+    return false;
+  }
+
+  // Checks whether the memory block starts with compact file header.
+  inline bool IsCompact(const void *data, size_t size){
+    return size>=sizeof(WaveCompactHeader) &&
+           memcmp(data,WAVECOMPACT_MAGIC,4)==0;
+  }
+
+  //-----------------------------------------------------------------
+
+  // Converts n floats to int16, optionally delta-encoded within each
+  // event of nSamples. Returns false if any sample can't be stored
+  // losslessly.
+  inline bool Encode(const float *in, size_t n, int nSamples, bool delta,
+                     int16_t *out){
+    for(size_t i=0; i<n; i++){
+      float x = in[i];
+      if(x!=std::floor(x) || x<-32768 || x>32767 || (x==0 && std::signbit(x)))
+        return false;
+      out[i] = (int16_t)x;
+    }
+    if(delta){
+      // differences are computed modulo 2^16, so they are always
+      // reversible, even if they don't fit in int16
+      for(size_t ev=0; ev<n; ev+=nSamples)
+        for(size_t i=ev+nSamples-1; i>ev; i--)
+          out[i] = (int16_t)((uint16_t)out[i]-(uint16_t)out[i-1]);
+    }
+    return true;
+  }
+
+  // Reverse of Encode(): restores samples of n/nSamples events and
+  // converts them to float.
+  inline void Decode(int16_t *in, size_t n, int nSamples, bool delta,
+                     float *out){
+    if(delta){
+      for(size_t ev=0; ev<n; ev+=nSamples)
+        for(size_t i=ev+1; i<ev+nSamples; i++)
+          in[i] = (int16_t)((uint16_t)in[i]+(uint16_t)in[i-1]);
+    }
+    for(size_t i=0; i<n; i++)
+      out[i] = in[i];
+  }
+
+  //-----------------------------------------------------------------
+
+  // Compresses size bytes from src and stores them in dst.
+  // Returns false if the codec isn't available.
+  inline bool Compress(uint32_t codec, int level, const void *src, size_t size,
+                       std::vector <char> &dst){
+    if(codec==kNone){
+      dst.assign((const char*)src,(const char*)src+size);
+      return true;
+    }
+#ifdef DD6_WITH_LZ4
+    if(codec==kLZ4){
+      dst.resize(LZ4_compressBound(size));
+      int csize = LZ4_compress_default((const char*)src,dst.data(),size,dst.size());
+      if(csize<=0) return false;
+      dst.resize(csize);
+      return true;
+    }
+#endif
+#ifdef DD6_WITH_ZSTD
+    if(codec==kZSTD){
+      dst.resize(ZSTD_compressBound(size));
+      size_t csize = ZSTD_compress(dst.data(),dst.size(),src,size,level);
+      if(ZSTD_isError(csize)) return false;
+      dst.resize(csize);
+      return true;
+    }
+#endif
+    (void)level;
+    return false;
+  }
+
+  // Decompresses csize bytes from src into exactly size bytes of dst.
+  inline bool Decompress(uint32_t codec, const void *src, size_t csize,
+                         void *dst, size_t size){
+    if(codec==kNone){
+      if(csize!=size) return false;
+      memcpy(dst,src,size);
+      return true;
+    }
+#ifdef DD6_WITH_LZ4
+    if(codec==kLZ4)
+      return LZ4_decompress_safe((const char*)src,(char*)dst,csize,size)==(int)size;
+#endif
+#ifdef DD6_WITH_ZSTD
+    if(codec==kZSTD){
+      size_t dsize = ZSTD_decompress(dst,size,src,csize);
+      return !ZSTD_isError(dsize) && dsize==size;
+    }
+#endif
+    return false;
+  }
+
+}
+
+//-----------------------------------------------------------------
+
+// Decoder of a compact file already mapped in memory (see WaveReader).
+// Returned pointers point to internal buffers and are valid until the
+// next call of GetEvents(). Not thread-safe.
+
+class WaveCompactDecoder{
+
+public:
+  WaveCompactDecoder() : fData(nullptr), fSize(0), fCachedChunk(-1) {}
+
+  // Checks header and index. Returns false and sets error otherwise.
+  bool Init(const char *data, size_t size, std::string &error);
+
+  const WaveCompactHeader& GetHeader(void) const { return fHeader; }
+  long long GetNEvents(void) const { return fHeader.nEvents; }
+
+  // Returns n consecutive decoded events starting with first, or
+  // nullptr in case of error.
+  const float* GetEvents(long long first, long long n);
+
+  // Byte range of the file holding events [first, first+n).
+  void GetByteRange(long long first, long long n, size_t &begin, size_t &end) const;
+
+private:
+  const char *fData;
+  size_t fSize;
+  WaveCompactHeader fHeader;
+  std::vector <WaveCompactChunk> fIndex;   // copied, in the file it isn't aligned
+  long long fCachedChunk;
+  std::vector <float> fChunk;      // decoded chunk
+  std::vector <float> fSpan;       // events spanning several chunks
+  std::vector <int16_t> fRaw;      // decompressed int16 samples
+
+  bool DecodeChunk(long long c, float *out);
+};
+
+//-----------------------------------------------------------------
+
+inline bool WaveCompactDecoder::Init(const char *data, size_t size, std::string &error){
+
+  if(!WaveCompact::IsCompact(data,size)){
+    error = "not a compact wave file";
+    return false;
+  }
+
+  memcpy(&fHeader,data,sizeof(fHeader));
+
+  if(fHeader.version!=1 || fHeader.nSamples==0 || fHeader.chunkEvents==0 ||
+     (uint64_t)fHeader.chunkEvents*fHeader.nSamples*sizeof(int16_t)>UINT32_MAX){
+    error = "unsupported version or corrupted header";
+    return false;
+  }
+
+  if(!WaveCompact::CodecAvailable(fHeader.codec)){
+    error = std::string("codec ")+WaveCompact::CodecName(fHeader.codec)+
+            " not available, compile with DD6_WITH_LZ4 / DD6_WITH_ZSTD";
+    return false;
+  }
+
+  if(fHeader.nChunks!=(fHeader.nEvents+fHeader.chunkEvents-1)/fHeader.chunkEvents ||
+     fHeader.indexOffset+fHeader.nChunks*sizeof(WaveCompactChunk)>size){
+    error = "corrupted or incomplete file (index)";
+    return false;
+  }
+
+  fData = data;
+  fSize = size;
+  fIndex.resize(fHeader.nChunks);
+  memcpy(fIndex.data(),data+fHeader.indexOffset,fHeader.nChunks*sizeof(WaveCompactChunk));
+
+  for(uint64_t c=0; c<fHeader.nChunks; c++){
+    if(fIndex[c].offset+fIndex[c].size>fHeader.indexOffset){
+      error = "corrupted or incomplete file (chunk outside of the data)";
+      return false;
+    }
+  }
+
+  fChunk.resize((size_t)fHeader.chunkEvents*fHeader.nSamples);
+  fRaw.resize(fChunk.size());
+
+  return true;
+}
+
+//-----------------------------------------------------------------
+
+inline bool WaveCompactDecoder::DecodeChunk(long long c, float *out){
+
+  long long first = c*fHeader.chunkEvents;
+  long long nev = fHeader.nEvents-first < fHeader.chunkEvents ?
+                  fHeader.nEvents-first : fHeader.chunkEvents;
+  size_t n = nev*fHeader.nSamples;
+
+  if(!WaveCompact::Decompress(fHeader.codec,fData+fIndex[c].offset,fIndex[c].size,
+                              fRaw.data(),n*sizeof(int16_t)))
+    return false;
+
+  WaveCompact::Decode(fRaw.data(),n,fHeader.nSamples,
+                      fHeader.flags & WaveCompact::kDelta,out);
+
+  return true;
+}
+
+//-----------------------------------------------------------------
+
+inline const float* WaveCompactDecoder::GetEvents(long long first, long long n){
+
+  if(first<0 || n<1 || first+n>(long long)fHeader.nEvents)
+    return nullptr;
+
+  const long long chunkEvents = fHeader.chunkEvents;
+  const long long c0 = first/chunkEvents;
+  const long long c1 = (first+n-1)/chunkEvents;
+
+  //----- all events within one chunk - served from the cache
+  if(c0==c1){
+    if(c0!=fCachedChunk){
+      if(!DecodeChunk(c0,fChunk.data())){
+        fCachedChunk = -1;
+        return nullptr;
+      }
+      fCachedChunk = c0;
+    }
+    return fChunk.data()+(first-c0*chunkEvents)*fHeader.nSamples;
+  }
+
+  //----- span of several chunks - decoded into separate buffer
+  fSpan.resize(n*fHeader.nSamples);
+
+  for(long long c=c0; c<=c1; c++){
+    if(c!=fCachedChunk){
+      if(!DecodeChunk(c,fChunk.data())){
+        fCachedChunk = -1;
+        return nullptr;
+      }
+      fCachedChunk = c;
+    }
+    long long from = c==c0 ? first : c*chunkEvents;
+    long long to = c==c1 ? first+n : (c+1)*chunkEvents;
+    memcpy(fSpan.data()+(from-first)*fHeader.nSamples,
+           fChunk.data()+(from-c*chunkEvents)*fHeader.nSamples,
+           (to-from)*fHeader.nSamples*sizeof(float));
+  }
+
+  return fSpan.data();
+}
+
+//-----------------------------------------------------------------
+
+inline void WaveCompactDecoder::GetByteRange(long long first, long long n,
+                                             size_t &begin, size_t &end) const{
+  const long long c0 = first/fHeader.chunkEvents;
+  const long long c1 = (first+n-1)/fHeader.chunkEvents;
+  begin = fIndex[c0].offset;
+  end = fIndex[c1].offset+fIndex[c1].size;
+}
+
+//-----------------------------------------------------------------
+
+#endif
@@ -0,0 +1,249 @@
+//************************************************
+//*                                              *
+//*                WaveFeatures.h                *
+//*                                              *
+//************************************************
+
+// Batch feature-extraction kernel for signals recorded by the Desktop
+// Digitizer. For N events x 1024 samples (e.g. a span returned by
+// WaveReader::GetEvents()) computes for every event:
+//   - base line and its RMS (first nBL samples),
+//   - amplitude (maximum above base line) and peak position,
+//   - integral of the base-line-subtracted signal in a window,
+//   - constant-fraction T0 (linear interpolation on the leading edge).
+// Values are scaled with the calibration factor (1/4.096 by default,
+// i.e. results in mV and mV*sample). All quantities are computed
+// while the event stays in cache. AVX2 is used when available on the
+// running CPU, otherwise scalar code is used. Events are distributed
+// among threads.
+//
+// Header is ROOT-free:
+//   FeatureConfig cfg;
+//   std::vector <SignalFeatures> out(n);
+//   ExtractFeatures(reader.GetEvents(slot,0,n), n, cfg, out.data());
+
+#ifndef __WaveFeatures_H_
+#define __WaveFeatures_H_ 1
+
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(__CLING__)
+#define WAVEFEATURES_AVX2 1
+#include <immintrin.h>
+#endif
+
+//-----------------------------------------------------------------
+
+struct SignalFeatures{
+  float fBL;        // base line
+  float fBLRMS;     // RMS of the base line
+  float fAmp;       // amplitude, base line subtracted
+  float fCharge;    // integral in the window, base line subtracted
+  float fT0;        // constant-fraction time [samples]
+  int   fPeak;      // position of the maximum [samples]
+};
+
+//-----------------------------------------------------------------
+
+struct FeatureConfig{
+  int   nSamples;   // number of samples in 1 signal
+  int   nBL;        // number of points for base line calculation
+  float scale;      // calibration factor applied to all amplitudes
+  int   intStart;   // first sample of the integration window
+  int   intLength;  // length of the integration window
+  float fraction;   // fraction of the amplitude for T0 determination
+
+  FeatureConfig() : nSamples(1024), nBL(50), scale(1./4.096),
+                    intStart(0), intLength(1024), fraction(0.3) {}
+};
+
+//-----------------------------------------------------------------
+
+namespace WaveFeaturesImpl{
+
+  // Partial results needed for one event: base line, sum of the
+  // base-line-subtracted integration window and position of the maximum.
+  struct Sums{
+    float bl;
+    float window;
+    int peak;
+  };
+
+  // Sum of (x[i]-offset); offset keeps float sums of ~1600 ADC
+  // samples away from cancellation.
+  inline float SumScalar(const float *x, int n, float offset){
+    float sum = 0;
+    for(int i=0; i<n; i++)
+      sum+=x[i]-offset;
+    return sum;
+  }
+
+  inline int MaxPosScalar(const float *x, int n){
+    int pos = 0;
+    for(int i=1; i<n; i++)
+      if(x[i]>x[pos]) pos = i;
+    return pos;
+  }
+
+  inline Sums ComputeScalar(const float *sig, const FeatureConfig &cfg){
+    Sums s;
+    s.bl = sig[0]+SumScalar(sig,cfg.nBL,sig[0])/cfg.nBL;
+    s.window = SumScalar(sig+cfg.intStart,cfg.intLength,s.bl);
+    s.peak = MaxPosScalar(sig,cfg.nSamples);
+    return s;
+  }
+
+#ifdef WAVEFEATURES_AVX2
+
+  __attribute__((target("avx2")))
+  inline float SumAVX2(const float *x, int n, float offset){
+    const __m256 voff = _mm256_set1_ps(offset);
+    __m256 acc = _mm256_setzero_ps();
+    int i = 0;
+    for(; i+8<=n; i+=8)
+      acc = _mm256_add_ps(acc,_mm256_sub_ps(_mm256_loadu_ps(x+i),voff));
+    float buf[8];
+    _mm256_storeu_ps(buf,acc);
+    float sum = buf[0]+buf[1]+buf[2]+buf[3]+buf[4]+buf[5]+buf[6]+buf[7];
+    for(; i<n; i++)
+      sum+=x[i]-offset;
+    return sum;
+  }
+
+  __attribute__((target("avx2")))
+  inline int MaxPosAVX2(const float *x, int n){
+    if(n<8)
+      return MaxPosScalar(x,n);
+    __m256 vmax = _mm256_loadu_ps(x);
+    int i = 8;
+    for(; i+8<=n; i+=8)
+      vmax = _mm256_max_ps(vmax,_mm256_loadu_ps(x+i));
+    float buf[8];
+    _mm256_storeu_ps(buf,vmax);
+    float max = buf[0];
+    for(int j=1; j<8; j++)
+      if(buf[j]>max) max = buf[j];
+    for(; i<n; i++)
+      if(x[i]>max) max = x[i];
+    // first occurrence of the maximum, same as the scalar version
+    int pos = 0;
+    while(x[pos]!=max) pos++;
+    return pos;
+  }
+
+  __attribute__((target("avx2")))
+  inline Sums ComputeAVX2(const float *sig, const FeatureConfig &cfg){
+    Sums s;
+    s.bl = sig[0]+SumAVX2(sig,cfg.nBL,sig[0])/cfg.nBL;
+    s.window = SumAVX2(sig+cfg.intStart,cfg.intLength,s.bl);
+    s.peak = MaxPosAVX2(sig,cfg.nSamples);
+    return s;
+  }
+
+  inline bool HasAVX2(void){
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+  }
+
+#endif
+
+  inline void ComputeEvent(const float *sig, const FeatureConfig &cfg,
+                           SignalFeatures &f, bool simd){
+#ifdef WAVEFEATURES_AVX2
+    Sums s = simd ? ComputeAVX2(sig,cfg) : ComputeScalar(sig,cfg);
+#else
+    (void)simd;
+    Sums s = ComputeScalar(sig,cfg);
+#endif
+    const float bl = s.bl;
+
+    float var = 0;
+    for(int i=0; i<cfg.nBL; i++)
+      var+=(sig[i]-bl)*(sig[i]-bl);
+
+    const float amp = sig[s.peak]-bl;
+
+    // constant fraction: last crossing of the threshold before the peak
+    const float thr = bl+cfg.fraction*amp;
+    int i = s.peak;
+    while(i>0 && sig[i-1]>=thr) i--;
+    float t0 = i;
+    if(i>0 && sig[i]!=sig[i-1])
+      t0 = (i-1)+(thr-sig[i-1])/(sig[i]-sig[i-1]);
+
+    f.fBL = bl*cfg.scale;
+    f.fBLRMS = std::sqrt(var/cfg.nBL)*cfg.scale;
+    f.fAmp = amp*cfg.scale;
+    f.fCharge = s.window*cfg.scale;
+    f.fT0 = t0;
+    f.fPeak = s.peak;
+  }
+
+}
+
+//-----------------------------------------------------------------
+
+// Computes features of a single signal. If simd is false scalar
+// code is used regardless of the CPU (reference implementation).
+
+inline void ExtractFeatures(const float *sig, const FeatureConfig &cfg,
+                            SignalFeatures &out, bool simd=true){
+#ifdef WAVEFEATURES_AVX2
+  simd = simd && WaveFeaturesImpl::HasAVX2();
+#endif
+  WaveFeaturesImpl::ComputeEvent(sig,cfg,out,simd);
+}
+
+//-----------------------------------------------------------------
+
+// Computes features of nevents consecutive signals stored in data
+// (nevents x cfg.nSamples floats) and stores them in out. Events are
+// split between nthreads threads (0 - number of cores).
+
+inline void ExtractFeatures(const float *data, long long nevents,
+                            const FeatureConfig &cfg, SignalFeatures *out,
+                            int nthreads=0, bool simd=true){
+
+#ifdef WAVEFEATURES_AVX2
+  simd = simd && WaveFeaturesImpl::HasAVX2();
+#endif
+
+  if(nthreads<=0)
+    nthreads = std::thread::hardware_concurrency();
+  if(nthreads<=0)
+    nthreads = 1;
+
+  // small batches are not worth starting threads
+  const long long minPerThread = 256;
+  if(nevents<nthreads*minPerThread)
+    nthreads = nevents/minPerThread > 0 ? nevents/minPerThread : 1;
+
+  auto work = [&](long long first, long long last){
+    for(long long i=first; i<last; i++)
+      WaveFeaturesImpl::ComputeEvent(data+i*cfg.nSamples,cfg,out[i],simd);
+  };
+
+  if(nthreads==1){
+    work(0,nevents);
+    return;
+  }
+
+  std::vector <std::thread> threads;
+  const long long block = (nevents+nthreads-1)/nthreads;
+
+  for(int t=0; t<nthreads; t++){
+    long long first = t*block;
+    long long last = first+block < nevents ? first+block : nevents;
+    if(first>=last) break;
+    threads.emplace_back(work,first,last);
+  }
+
+  for(size_t t=0; t<threads.size(); t++)
+    threads[t].join();
+}
+
+//-----------------------------------------------------------------
+
+#endif
@@ -0,0 +1,434 @@
+//************************************************
+//*                                              *
+//*                 WaveReader.h                 *
+//*                                              *
+//************************************************
+
+// Zero-copy random-access reader for binary files recorded by the
+// Desktop Digitizer (wave_N.dat). Each file is a flat sequence of
+// float32 samples, 1024 samples per event. Files are memory-mapped,
+// so requesting a signal returns a pointer directly into the page
+// cache - nothing is copied and nothing is read until it is touched.
+// One reader may hold several channel files; each opened file gets
+// a slot number which is used to access its events. The number of
+// events of the reader is the smallest number of events among the
+// opened channels, so correlated signals can be accessed safely.
+// Compact files wave_N.ddc (see WaveCompact.h) are recognized and
+// read transparently. For them signals are decoded into a buffer of
+// the slot, so returned pointer stays valid only until the next
+// GetEvent()/GetEvents() call for the same slot. Streaming callers
+// should read spans of GetReadChunk() events, so that each span is
+// decoded from a single chunk of the compact file.
+// Files still being written by the digitizer can be opened as
+// growing: incomplete last event is ignored and Refresh() maps
+// events appended since the previous call.
+//
+// Header is ROOT-free and can be used both from ROOT macros and
+// from standalone programs:
+//   WaveReader reader;
+//   int s0 = reader.OpenChannel("./",0);
+//   int s1 = reader.OpenChannel("./",1);
+//   for(long long i=0; i<reader.GetNEvents(); i++){
+//     const float *sig0 = reader.GetEvent(s0,i);
+//     const float *sig1 = reader.GetEvent(s1,i);
+//   }
+
+#ifndef __WaveReader_H_
+#define __WaveReader_H_ 1
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "WaveCompact.h"
+
+//-----------------------------------------------------------------
+
+class WaveReader{
+
+public:
+  static const int kSamples = 1024;   // number of samples in 1 signal
+  static const long long kEventSize = kSamples*sizeof(float);   // bytes per signal
+
+  // Access pattern hints, passed to madvise()
+  enum AccessHint { kNormal, kSequential, kRandom };
+
+  WaveReader() : fNEvents(0), fHint(kNormal) {}
+  ~WaveReader() { Close(); }
+
+  WaveReader(const WaveReader&) = delete;
+  WaveReader& operator=(const WaveReader&) = delete;
+
+  // Opens a single binary file. Returns slot number of the
+  // file or -1 if the file couldn't be opened or mapped.
+  // If growing is set, the file may still be written (only
+  // complete events are accessible), see Refresh().
+  int Open(const std::string &fname, bool growing=false);
+
+  // Opens wave_<ch>.dat located in the directory path, or
+  // wave_<ch>.ddc if there is no .dat file.
+  int OpenChannel(const std::string &path, int ch, bool growing=false);
+
+  // Checks sizes of the files opened as growing and maps complete
+  // events appended since the last call. Returns the number of
+  // events. Pointers obtained before the call become invalid.
+  // Returns -1 if a growing file got smaller or was replaced (e.g.
+  // overwritten by a new acquisition); its slot is unmapped and has
+  // no events, so the files have to be closed and opened again.
+  long long Refresh(void);
+
+  // Unmaps all files.
+  void Close(void);
+
+  int GetNSlots(void) const { return fFiles.size(); }
+  long long GetNEvents(void) const { return fNEvents; }
+  long long GetNEvents(int slot) const;
+  const std::string& GetFileName(int slot) const { return fFiles[slot].name; }
+
+  // Returns pointer to 1024 samples of the event i from the
+  // given slot, or nullptr if the event doesn't exist.
+  const float* GetEvent(int slot, long long i) const;
+
+  // Returns pointer to n consecutive events starting with the
+  // event first (n*1024 samples), or nullptr if the span exceeds
+  // the file.
+  const float* GetEvents(int slot, long long first, long long n) const;
+
+  // Number of events to read at once when streaming through the
+  // files. Returns n if only raw files are opened. Otherwise returns
+  // the chunk size of the compact files (the largest one common to
+  // all of them), also if n is smaller - chunks are decoded as a
+  // whole anyway. Spans read one after another then never cover more
+  // than one chunk and no additional decoding buffer is needed.
+  long long GetReadChunk(long long n) const;
+
+  // Sets access hint for all opened files (and files opened later).
+  void SetAccessHint(AccessHint hint);
+
+  // Asks the kernel to prefetch n events starting with first
+  // in all slots. Useful before random-access reading of
+  // a sorted list of events.
+  void WillNeed(long long first, long long n) const;
+
+  // Tells the kernel that n events starting with first won't be
+  // needed any more, so mapped pages can be dropped. Keeps memory
+  // use constant while streaming through large files.
+  void DontNeed(long long first, long long n) const;
+
+private:
+  struct MappedFile{
+    std::string name;
+    int fd;
+    const float *data;
+    size_t size;
+    long long nevents;
+    bool growing;
+    std::shared_ptr <WaveCompactDecoder> compact;   // only for compact files
+  };
+
+  std::vector <MappedFile> fFiles;
+  long long fNEvents;
+  AccessHint fHint;
+
+  void Advise(const MappedFile &f, AccessHint hint) const;
+  void UpdateNEvents(void);
+};
+
+//-----------------------------------------------------------------
+
+inline int WaveReader::Open(const std::string &fname, bool growing){
+
+  MappedFile f;
+  f.name = fname;
+  f.fd = -1;
+  f.data = nullptr;
+  f.size = 0;
+  f.nevents = 0;
+  f.growing = false;
+
+  f.fd = open(fname.c_str(), O_RDONLY);
+  if(f.fd<0){
+    std::cout << "##### Couldn't open file " << fname << std::endl;
+    return -1;
+  }
+
+  struct stat st;
+  if(fstat(f.fd,&st)!=0){
+    std::cout << "##### Couldn't stat file " << fname << std::endl;
+    close(f.fd);
+    return -1;
+  }
+
+  f.size = st.st_size;
+
+  char magic[4] = {0,0,0,0};
+  bool compact = f.size>=sizeof(WaveCompactHeader) &&
+                 pread(f.fd,magic,4,0)==4 &&
+                 WaveCompact::IsCompact(magic,sizeof(WaveCompactHeader));
+
+  // incomplete last event of a growing file is not mapped
+  if(!compact && growing){
+    f.growing = true;
+    f.size -= f.size % kEventSize;
+  }
+
+  if(!compact && f.size % kEventSize != 0){
+    std::cout << "##### File " << fname << " is corrupted or incomplete!" << std::endl;
+    std::cout << "##### Size " << f.size << " B is not a multiple of "
+              << kSamples << " floats" << std::endl;
+    close(f.fd);
+    return -1;
+  }
+
+  f.nevents = compact ? 0 : f.size/kEventSize;
+
+  if(f.size>0){
+    void *ptr = mmap(nullptr, f.size, PROT_READ, MAP_SHARED, f.fd, 0);
+    if(ptr==MAP_FAILED){
+      std::cout << "##### Couldn't map file " << fname << std::endl;
+      close(f.fd);
+      return -1;
+    }
+    f.data = static_cast<const float*>(ptr);
+  }
+
+  if(compact){
+    std::string error;
+    f.compact = std::make_shared<WaveCompactDecoder>();
+    if(!f.compact->Init((const char*)f.data,f.size,error) ||
+       f.compact->GetHeader().nSamples!=kSamples){
+      std::cout << "##### Couldn't read compact file " << fname << ": "
+                << (error.empty() ? "wrong number of samples" : error) << std::endl;
+      munmap(const_cast<float*>(f.data), f.size);
+      close(f.fd);
+      return -1;
+    }
+    f.nevents = f.compact->GetNEvents();
+  }
+
+  Advise(f,fHint);
+
+  fFiles.push_back(f);
+  UpdateNEvents();
+
+  return fFiles.size()-1;
+}
+
+//-----------------------------------------------------------------
+
+inline int WaveReader::OpenChannel(const std::string &path, int ch, bool growing){
+  std::string fname = path+"wave_"+std::to_string(ch);
+  if(access((fname+".dat").c_str(),F_OK)!=0 && access((fname+".ddc").c_str(),F_OK)==0)
+    return Open(fname+".ddc");
+  return Open(fname+".dat",growing);
+}
+
+//-----------------------------------------------------------------
+
+inline long long WaveReader::Refresh(void){
+
+  bool truncated = false;
+
+  for(size_t i=0; i<fFiles.size(); i++){
+    MappedFile &f = fFiles[i];
+    if(!f.growing)
+      continue;
+
+    struct stat st, st_name;
+    if(fstat(f.fd,&st)!=0)
+      continue;
+
+    // pages of the old mapping beyond the new end of the file can't be
+    // touched (SIGBUS), so the slot is invalidated
+    bool replaced = stat(f.name.c_str(),&st_name)!=0 ||
+                    st_name.st_ino!=st.st_ino || st_name.st_dev!=st.st_dev;
+    if((size_t)st.st_size<f.size || replaced){
+      std::cout << "##### File " << f.name << " was truncated or replaced" << std::endl;
+      if(f.data)
+        munmap(const_cast<float*>(f.data), f.size);
+      f.data = nullptr;
+      f.size = 0;
+      f.nevents = 0;
+      f.growing = false;
+      truncated = true;
+      continue;
+    }
+
+    size_t size = st.st_size - st.st_size % kEventSize;
+    if(size<=f.size)
+      continue;
+
+    // new mapping is created first, so the old one stays valid
+    // if mapping fails
+    void *ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, f.fd, 0);
+    if(ptr==MAP_FAILED){
+      std::cout << "##### Couldn't map file " << f.name << std::endl;
+      continue;
+    }
+    if(f.data)
+      munmap(const_cast<float*>(f.data), f.size);
+
+    f.data = static_cast<const float*>(ptr);
+    f.size = size;
+    f.nevents = size/kEventSize;
+    Advise(f,fHint);
+  }
+
+  UpdateNEvents();
+
+  return truncated ? -1 : fNEvents;
+}
+
+//-----------------------------------------------------------------
+
+inline void WaveReader::Close(void){
+
+  for(size_t i=0; i<fFiles.size(); i++){
+    if(fFiles[i].data)
+      munmap(const_cast<float*>(fFiles[i].data), fFiles[i].size);
+    if(fFiles[i].fd>=0)
+      close(fFiles[i].fd);
+  }
+
+  fFiles.clear();
+  fNEvents = 0;
+}
+
+//-----------------------------------------------------------------
+
+inline long long WaveReader::GetNEvents(int slot) const{
+  if(slot<0 || slot>=(int)fFiles.size())
+    return 0;
+  return fFiles[slot].nevents;
+}
+
+//-----------------------------------------------------------------
+
+inline const float* WaveReader::GetEvent(int slot, long long i) const{
+  return GetEvents(slot,i,1);
+}
+
+//-----------------------------------------------------------------
+
+inline const float* WaveReader::GetEvents(int slot, long long first, long long n) const{
+
+  if(slot<0 || slot>=(int)fFiles.size())
+    return nullptr;
+
+  const MappedFile &f = fFiles[slot];
+
+  if(first<0 || n<1 || first+n>f.nevents)
+    return nullptr;
+
+  if(f.compact)
+    return f.compact->GetEvents(first,n);
+
+  return f.data + first*kSamples;
+}
+
+//-----------------------------------------------------------------
+
+inline long long WaveReader::GetReadChunk(long long n) const{
+
+  // largest chunk size common to all compact files
+  long long common = 0;
+  for(size_t i=0; i<fFiles.size(); i++){
+    if(!fFiles[i].compact)
+      continue;
+    long long c = fFiles[i].compact->GetHeader().chunkEvents;
+    while(c!=0){
+      long long r = common % c;
+      common = c;
+      c = r;
+    }
+  }
+
+  if(common==0)
+    return n;
+
+  return common;
+}
+
+//-----------------------------------------------------------------
+
+inline void WaveReader::SetAccessHint(AccessHint hint){
+  fHint = hint;
+  for(size_t i=0; i<fFiles.size(); i++)
+    Advise(fFiles[i],hint);
+}
+
+//-----------------------------------------------------------------
+
+inline void WaveReader::WillNeed(long long first, long long n) const{
+
+  for(size_t i=0; i<fFiles.size(); i++){
+    const MappedFile &f = fFiles[i];
+    if(first<0 || first>=f.nevents || n<1)
+      continue;
+    long long last = first+n < f.nevents ? first+n : f.nevents;
+    // madvise() requires page-aligned address
+    const long page = sysconf(_SC_PAGESIZE);
+    size_t begin = first*kEventSize;
+    size_t end = last*kEventSize;
+    if(f.compact)
+      f.compact->GetByteRange(first,last-first,begin,end);
+    begin -= begin % page;
+    madvise((char*)f.data+begin, end-begin, MADV_WILLNEED);
+  }
+}
+
+//-----------------------------------------------------------------
+
+inline void WaveReader::DontNeed(long long first, long long n) const{
+
+  for(size_t i=0; i<fFiles.size(); i++){
+    const MappedFile &f = fFiles[i];
+    if(first<0 || first>=f.nevents || n<1)
+      continue;
+    long long last = first+n < f.nevents ? first+n : f.nevents;
+    // only whole pages inside the span can be dropped
+    const long page = sysconf(_SC_PAGESIZE);
+    size_t begin = first*kEventSize;
+    size_t end = last*kEventSize;
+    if(f.compact)
+      f.compact->GetByteRange(first,last-first,begin,end);
+    begin += (page - begin % page) % page;
+    if(last<f.nevents)
+      end -= end % page;
+    if(end>begin)
+      madvise((char*)f.data+begin, end-begin, MADV_DONTNEED);
+  }
+}
+
+//-----------------------------------------------------------------
+
+inline void WaveReader::Advise(const MappedFile &f, AccessHint hint) const{
+
+  if(f.data==nullptr)
+    return;
+
+  int advice = MADV_NORMAL;
+  if(hint==kSequential)
+    advice = MADV_SEQUENTIAL;
+  else if(hint==kRandom)
+    advice = MADV_RANDOM;
+
+  madvise((void*)f.data, f.size, advice);
+}
+
+//-----------------------------------------------------------------
+
+inline void WaveReader::UpdateNEvents(void){
+  fNEvents = fFiles.empty() ? 0 : fFiles[0].nevents;
+  for(size_t i=1; i<fFiles.size(); i++)
+    if(fFiles[i].nevents<fNEvents)
+      fNEvents = fFiles[i].nevents;
+}
+
+//-----------------------------------------------------------------
+
+#endif